@@ -0,0 +1,105 @@
+/*
+ * Canonical states for the sokoban solver.
+ *
+ * Two states are the same puzzle if they have the same boxes and the worker
+ * can walk from one worker position to the other; we always place the
+ * worker in the least cell it can reach.  Many levels are also symmetric:
+ * a mirror image or rotation of the floor (with its storage) may land on the
+ * floor again.  Then a state and its images are equally hard, and the least
+ * of them stands for all.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "solve.h"
+
+// compute the image of position (r,c) under transformation t, given the
+// bounding rectangle [r0..r1]x[c0..c1]; returns -1 if it falls outside
+static int transform(int t, int r, int c, int r0, int c0, int r1, int c1)
+{
+  int h = r1-r0, w = c1-c0;
+  int x = r-r0, y = c-c0;
+  int nr, nc;
+  switch (t) {
+  case 0: nr = x;   nc = y;   break; // identity
+  case 1: nr = x;   nc = w-y; break; // mirror left-right
+  case 2: nr = h-x; nc = y;   break; // mirror top-bottom
+  case 3: nr = h-x; nc = w-y; break; // half turn
+  case 4: nr = y;   nc = x;   break; // transpose
+  case 5: nr = y;   nc = h-x; break; // quarter turn clockwise
+  case 6: nr = w-y; nc = x;   break; // quarter turn counter-clockwise
+  default: nr = w-y; nc = h-x; break; // anti-transpose
+  }
+  nr += r0; nc += c0;
+  if (nr < 0 || nc < 0 || nr >= 64 || nc >= 64) return -1;
+  return rc2p(nr,nc);
+}
+
+// find the transformations that carry the floor and storage onto themselves
+// (called once, after analyze); returns the number found, including identity
+int findSymmetries(board *b)
+{
+  int r0 = 64, c0 = 64, r1 = -1, c1 = -1;
+  int t, x, y, p, r, c;
+
+  // bounding rectangle of the floor
+  for (x = 0; x < b->cells; x++) {
+    p2rc(b->pos[x],&r,&c);
+    if (r < r0) r0 = r;
+    if (r > r1) r1 = r;
+    if (c < c0) c0 = c;
+    if (c > c1) c1 = c;
+  }
+
+  b->symmetries = 0;
+  for (t = 0; t < 8; t++) {
+    for (x = 0; x < b->cells; x++) {
+      p2rc(b->pos[x],&r,&c);
+      p = transform(t,r,c,r0,c0,r1,c1);
+      y = (p < 0) ? -1 : b->cell[p];
+      if (y < 0 || b->goal[y] != b->goal[x]) break;
+      b->map[b->symmetries][x] = y;
+    }
+    // every cell landed on a like cell: keep it
+    if (x == b->cells) b->symmetries++;
+  }
+  return b->symmetries;
+}
+
+// replace s by the canonical representative of its class
+void canonical(board *b, unsigned short *s)
+{
+  unsigned short best[MAXBOX+1], image[MAXBOX+1];
+  int reached, i, j, t, x, least;
+  int *map;
+
+  // the worker's region, with the identity mapping
+  placeBoxes(b,s,1);
+  reached = flood(b,s[0]);
+  placeBoxes(b,s,0);
+  least = s[0];
+  for (i = 0; i < reached; i++) {
+    if (b->queue[i] < least) least = b->queue[i];
+  }
+  s[0] = least;
+  if (b->symmetries < 2) return;
+
+  // try the images of s; the worker region maps onto the image's region
+  memcpy(best,s,b->stateSize);
+  for (t = 1; t < b->symmetries; t++) {
+    map = b->map[t];
+    least = map[b->queue[0]];
+    for (i = 1; i < reached; i++) {
+      if (map[b->queue[i]] < least) least = map[b->queue[i]];
+    }
+    image[0] = least;
+    // map the boxes, keeping them in order
+    for (i = 1; i <= b->boxes; i++) {
+      x = map[s[i]];
+      for (j = i; j > 1 && image[j-1] > x; j--) image[j] = image[j-1];
+      image[j] = x;
+    }
+    if (memcmp(image,best,b->stateSize) < 0) memcpy(best,image,b->stateSize);
+  }
+  memcpy(s,best,b->stateSize);
+}
@@ -0,0 +1,509 @@
+/*
+ * Deadlock detection for the sokoban solver.
+ *
+ * Dead squares (see analyze) catch a single box pushed where it can never
+ * be stored.  Here we catch two more expensive kinds of trouble:
+ *
+ *  - Frozen boxes.  A box is frozen if it is blocked both across and along:
+ *    by walls, or by other boxes that are frozen themselves.  Frozen boxes
+ *    never move again, so a frozen box off storage is a deadlock.  Every
+ *    frozen group found is remembered as a pattern: any state that has
+ *    those boxes is dead.  Patterns are kept, between runs, in a file per
+ *    level.  Small patterns, described by the walls around them, apply to
+ *    every level, and are kept in a shared file.  Both files are mapped
+ *    into memory when the solver starts.
+ *
+ *  - Corrals.  A corral is a region the worker cannot reach.  If every box
+ *    on its fence can only be pushed into it, and the worker can make all of
+ *    those pushes now (a "PI-corral"), then some box of the fence has to be
+ *    pushed in before anything useful happens inside, and nothing outside
+ *    stops that push from being made first.  So we consider only those
+ *    pushes.  If there aren't any, the corral is a deadlock.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "solve.h"
+
+// Pattern database parameters
+#define PATTERNBOXES 6        // most boxes in a saved pattern
+#define MAXLEARNED (1<<20)    // most patterns learned in a run (memory allowing)
+#define PATTERNMAGIC 0x536f6b44 // "SokD": identifies our pattern files
+
+// A frozen group, stored under one of its boxes (the anchor); a pattern of
+// n boxes is stored n times, once under each
+typedef struct pattern_st {
+  unsigned short anchor;              // the cell it is filed under
+  unsigned short size;                // boxes in the pattern
+  unsigned short box[PATTERNBOXES];   // their cells, in increasing order
+} pattern;
+
+// A small frozen group, as it looks in a 4x4 window of any level; the
+// boxes lie in the center 2x2, against its top and left sides
+// (bit 4*row+col of each mask describes that cell of the window)
+typedef struct shape_st {
+  unsigned short walls;   // cells that are not floor
+  unsigned short boxes;   // the frozen boxes
+  unsigned short goals;   // which of those are in storage
+} shape;
+
+// The header of a pattern file
+typedef struct patternFile_st {
+  int magic;              // PATTERNMAGIC
+  unsigned int level;     // hash of the level (0 for shared shapes)
+  long count;             // records that follow
+} patternFile;
+
+//
+// Global variables.
+//
+static pattern *Known;        // patterns read from file (mapped), by anchor
+static long KnownCount = 0;
+static size_t KnownBytes = 0; // size of the mapping
+static pattern *Learned;      // patterns found this run
+static int *LearnedNext;      // next pattern with the same anchor, or -1
+static int LearnedHead[MAXPOS];// first learned pattern under each cell
+static long LearnedCount = 0;
+static long MaxLearned = 0;   // allocation of Learned
+static long LearnedLimit = 0; // most patterns the memory allows
+static shape *KnownShapes;    // shared shapes read from file (mapped)
+static long KnownShapeCount = 0;
+static size_t KnownShapeBytes = 0;
+static shape *LearnedShapes;  // shapes found this run
+static long LearnedShapeCount = 0;
+static long MaxShapes = 0;
+static long Hits = 0;         // deadlocks found in the database
+static char Wall[MAXPOS];     // cells treated as walls while freezing
+static int Frozen[4*MAXBOX];  // boxes found frozen (perhaps more than once)
+static int FrozenCount = 0;
+
+/****************************************************************************
+ * Frozen boxes
+ */
+static int stuck(board *b, int x);
+
+// true iff the box at x is blocked along the axis of direction d
+static int blocked(board *b, int x, int d)
+{
+  int y = b->next[x][d], z = b->next[x][opposite(d)];
+  if (y < 0 || Wall[y] || z < 0 || Wall[z]) return 1;
+  if (b->boxAt[y] && stuck(b,y)) return 1;
+  if (b->boxAt[z] && stuck(b,z)) return 1;
+  return 0;
+}
+
+// true iff the box at x can never move again; the boxes that hold it in
+// place are added to Frozen
+static int stuck(board *b, int x)
+{
+  int mark = FrozenCount;
+  int result;
+
+  // while we look at its neighbours, this box counts as a wall
+  Wall[x] = 1;
+  result = blocked(b,x,NORTH) && blocked(b,x,EAST);
+  Wall[x] = 0;
+  if (!result) FrozenCount = mark;
+  else if (FrozenCount < 4*MAXBOX) Frozen[FrozenCount++] = x;
+  return result;
+}
+
+// compare two shorts (for qsort)
+static int compareShorts(const void *a, const void *b)
+{
+  return *(unsigned short*)a - *(unsigned short*)b;
+}
+
+/****************************************************************************
+ * Shapes
+ */
+// the cell at row r, column c, or -1 if it is not floor
+static int cellAt(board *b, int r, int c)
+{
+  if (r < 0 || c < 0 || r >= 64 || c >= 64) return -1;
+  return b->cell[rc2p(r,c)];
+}
+
+// describe the walls and storage of the window with top left corner
+// [r,c]; boxes gets the boxes of the center 2x2
+static void window(board *b, int r, int c, shape *w)
+{
+  int i, j, x;
+  w->walls = w->boxes = w->goals = 0;
+  for (i = 0; i < 4; i++) {
+    for (j = 0; j < 4; j++) {
+      x = cellAt(b,r+i,c+j);
+      if (x < 0) w->walls |= 1<<(4*i+j);
+      else {
+	if (b->goal[x]) w->goals |= 1<<(4*i+j);
+	if (b->boxAt[x] && i > 0 && i < 3 && j > 0 && j < 3)
+	  w->boxes |= 1<<(4*i+j);
+      }
+    }
+  }
+}
+
+// compare two shapes (for qsort and bsearch)
+static int compareShapes(const void *a, const void *b)
+{
+  return memcmp(a,b,sizeof(shape));
+}
+
+// true iff shape s is a known deadlock
+static int knownShape(shape *s)
+{
+  long i;
+  if (KnownShapeCount &&
+      bsearch(s,KnownShapes,KnownShapeCount,sizeof(shape),compareShapes))
+    return 1;
+  for (i = 0; i < LearnedShapeCount; i++) {
+    if (0 == compareShapes(s,&LearnedShapes[i])) return 1;
+  }
+  return 0;
+}
+
+// true iff the boxes around cell x match a known shape
+static int matchShape(board *b, int x)
+{
+  shape w, s;
+  int r, c, dr, dc, sub, top, left;
+
+  p2rc(b->pos[x],&r,&c);
+  // the shape's 2x2 center has x in one of its four corners
+  for (dr = 0; dr < 2; dr++) {
+    for (dc = 0; dc < 2; dc++) {
+      window(b,r-dr-1,c-dc-1,&w);
+      // try the groups of boxes in the center that include x, and that
+      // touch the top and left sides of the center
+      for (sub = 1; sub < 16; sub++) {
+	s.boxes = ((sub&1)<<5) | ((sub&2)<<5) | ((sub&4)<<7) | ((sub&8)<<7);
+	if ((s.boxes & w.boxes) != s.boxes) continue;
+	if (!(s.boxes & 1<<(4*(dr+1)+dc+1))) continue;
+	top = s.boxes & 0x0060;
+	left = s.boxes & 0x0220;
+	if (!top || !left) continue;
+	s.walls = w.walls;
+	s.goals = w.goals & s.boxes;
+	if (knownShape(&s)) return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/****************************************************************************
+ * Patterns
+ */
+// true iff every box of pattern p is on the board
+static int present(board *b, pattern *p)
+{
+  int i;
+  for (i = 0; i < p->size; i++) {
+    if (!b->boxAt[p->box[i]]) return 0;
+  }
+  return 1;
+}
+
+// true iff a known pattern includes the box at cell x
+static int matchPattern(board *b, int x)
+{
+  long lo = 0, hi = KnownCount, mid;
+  int i;
+
+  // the patterns filed under x are together: find the first
+  while (lo < hi) {
+    mid = (lo+hi)/2;
+    if (Known[mid].anchor < x) lo = mid+1;
+    else hi = mid;
+  }
+  for (; lo < KnownCount && Known[lo].anchor == x; lo++) {
+    if (present(b,&Known[lo])) return 1;
+  }
+  for (i = LearnedHead[x]; i >= 0; i = LearnedNext[i]) {
+    if (present(b,&Learned[i])) return 1;
+  }
+  return 0;
+}
+
+// remember the Frozen boxes as a deadlock
+static void learn(board *b)
+{
+  unsigned short box[4*MAXBOX];
+  pattern p;
+  shape s;
+  int n = 0, i, j, r, c, top = 64, left = 64;
+
+  // Frozen may list a box more than once
+  for (i = 0; i < FrozenCount; i++) {
+    for (j = 0; j < n && box[j] != Frozen[i]; j++);
+    if (j == n) box[n++] = Frozen[i];
+  }
+  qsort(box,n,sizeof(unsigned short),compareShorts);
+
+  if (n <= PATTERNBOXES && LearnedCount+n <= LearnedLimit) {
+    if (LearnedCount+n > MaxLearned) {
+      MaxLearned = MaxLearned ? 2*MaxLearned : 1024;
+      if (MaxLearned > LearnedLimit) MaxLearned = LearnedLimit;
+      Learned = (pattern*)realloc(Learned,MaxLearned*sizeof(pattern));
+      LearnedNext = (int*)realloc(LearnedNext,MaxLearned*sizeof(int));
+    }
+    memset(&p,0,sizeof(p));
+    p.size = n;
+    memcpy(p.box,box,n*sizeof(unsigned short));
+    for (i = 0; i < n; i++) {
+      p.anchor = box[i];
+      Learned[LearnedCount] = p;
+      LearnedNext[LearnedCount] = LearnedHead[box[i]];
+      LearnedHead[box[i]] = LearnedCount++;
+    }
+  }
+
+  // small groups go in the shared database, too
+  for (i = 0; i < n; i++) {
+    p2rc(b->pos[box[i]],&r,&c);
+    if (r < top) top = r;
+    if (c < left) left = c;
+  }
+  for (i = 0; i < n; i++) {
+    p2rc(b->pos[box[i]],&r,&c);
+    if (r > top+1 || c > left+1) return;
+  }
+  window(b,top-1,left-1,&s);
+  s.boxes = 0;
+  for (i = 0; i < n; i++) {
+    p2rc(b->pos[box[i]],&r,&c);
+    s.boxes |= 1<<(4*(r-top+1)+c-left+1);
+  }
+  s.goals &= s.boxes;
+  if (knownShape(&s)) return;
+  if (LearnedShapeCount == MaxShapes) {
+    MaxShapes = MaxShapes ? 2*MaxShapes : 64;
+    LearnedShapes = (shape*)realloc(LearnedShapes,MaxShapes*sizeof(shape));
+  }
+  LearnedShapes[LearnedShapeCount++] = s;
+}
+
+// true iff pushing a box onto cell x leads to a deadlock
+// (boxAt must reflect the state after the push)
+int deadlocked(board *b, int x)
+{
+  int i;
+
+  if (matchPattern(b,x) || matchShape(b,x)) {
+    Hits++;
+    return 1;
+  }
+  FrozenCount = 0;
+  if (!stuck(b,x)) return 0;
+  if (FrozenCount == 4*MAXBOX) return 0; // lost track: play it safe
+  // frozen is fine, so long as it's frozen in storage
+  for (i = 0; i < FrozenCount; i++) {
+    if (!b->goal[Frozen[i]]) {
+      learn(b);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/****************************************************************************
+ * Corrals
+ */
+// look for a PI-corral in state s (placeBoxes and flood must have been
+// called); marks the cells of the best one found with b->corralChosen
+// returns 1 if found, 0 if not, and -1 if s is a corral deadlock
+int findCorral(board *b, unsigned short *s)
+{
+  static int queue[MAXPOS];
+  unsigned first, label, best = 0; // labels start at 1: 0 is none
+  int bestPushes = 0;
+  int head, tail, x, y, z, d, from;
+  int pi, pushes, unsolved, open;
+
+  // each region gets a new label; start over before the labels wrap
+  if (b->corralMark > UINT_MAX-b->cells) {
+    memset(b->corral,0,sizeof(b->corral));
+    b->corralMark = 0;
+  }
+  first = b->corralMark+1;
+
+  for (x = 0; x < b->cells; x++) {
+    if (b->reach[x] == b->reachMark || b->corral[x] >= first) continue;
+    // a new region: gather it up
+    label = ++b->corralMark;
+    b->corral[x] = label;
+    head = tail = 0;
+    queue[tail++] = x;
+    while (head < tail) {
+      y = queue[head++];
+      for (d = NORTH; d <= WEST; d++) {
+	z = b->next[y][d];
+	if (z < 0 || b->reach[z] == b->reachMark || b->corral[z] == label)
+	  continue;
+	b->corral[z] = label;
+	queue[tail++] = z;
+      }
+    }
+    // is it a PI-corral, and what pushes does it allow?
+    pi = 1;
+    pushes = unsolved = open = 0;
+    for (head = 0; pi && head < tail; head++) {
+      y = queue[head];
+      if (b->room[y] || y == b->entrance) pi = 0; // leave it to the macros
+      if (!b->boxAt[y]) {
+	open = 1;
+	// empty storage needs a box only if there is none to spare
+	if (b->goal[y] && b->goals == b->boxes) unsolved = 1;
+	continue;
+      }
+      if (!b->goal[y]) unsolved = 1;
+      for (d = NORTH; d <= WEST; d++) {
+	from = b->next[y][opposite(d)];
+	z = b->next[y][d];
+	if (from < 0 || b->reach[from] != b->reachMark) continue;
+	if (z < 0 || b->dead[z]) continue;
+	if (b->corral[z] != label) pi = 0; // could be pushed out
+	else if (!b->boxAt[z]) pushes++;
+      }
+    }
+    if (!pi || !open || !unsolved) continue;
+    if (pushes == 0) return -1;
+    if (best == 0 || pushes < bestPushes) {
+      best = label;
+      bestPushes = pushes;
+    }
+  }
+  b->corralChosen = best;
+  return best != 0;
+}
+
+/****************************************************************************
+ * Pattern files
+ */
+// a hash of the floor and storage of the level (patterns are by cell)
+static unsigned int levelHash(board *b)
+{
+  unsigned int h = 2166136261u;
+  int x;
+  for (x = 0; x < b->cells; x++) {
+    h = (h ^ b->pos[x]) * 16777619u;
+    h = (h ^ b->goal[x]) * 16777619u;
+  }
+  return h ? h : 1;
+}
+
+// map a pattern file into memory; returns the records (and their count
+// and the bytes mapped), or 0 if the file is missing or not for level
+static void *mapFile(char *name, unsigned int level, long size, long *count,
+		     size_t *bytes)
+{
+  struct stat st;
+  patternFile *h;
+  void *map;
+  int fd = open(name,O_RDONLY);
+
+  *count = 0;
+  *bytes = 0;
+  if (fd < 0) return 0;
+  if (fstat(fd,&st) || st.st_size < sizeof(patternFile)) {
+    close(fd);
+    return 0;
+  }
+  map = mmap(0,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+  close(fd);
+  if (map == MAP_FAILED) return 0;
+  h = (patternFile*)map;
+  if (h->magic != PATTERNMAGIC || h->level != level ||
+      st.st_size != sizeof(patternFile)+h->count*size) {
+    munmap(map,st.st_size);
+    return 0;
+  }
+  *count = h->count;
+  *bytes = st.st_size;
+  return (char*)map+sizeof(patternFile);
+}
+
+// write count records of the given size, sorted, to a pattern file
+static void writeFile(char *name, unsigned int level, void *records,
+		      long count, long size, int (*compare)(const void*,const void*))
+{
+  char tmpName[100];
+  patternFile h[1];
+  FILE *f;
+
+  sprintf(tmpName,"%.90s.tmp",name);
+  f = fopen(tmpName,"w");
+  if (f == 0) return;
+  qsort(records,count,size,compare);
+  h->magic = PATTERNMAGIC;
+  h->level = level;
+  h->count = count;
+  fwrite(h,sizeof(patternFile),1,f);
+  fwrite(records,size,count,f);
+  if (fclose(f)) unlink(tmpName);
+  else rename(tmpName,name);
+}
+
+// compare patterns by anchor, then contents
+static int comparePatterns(const void *a, const void *b)
+{
+  pattern *p = (pattern*)a, *q = (pattern*)b;
+  if (p->anchor != q->anchor) return p->anchor - q->anchor;
+  return memcmp(p,q,sizeof(pattern));
+}
+
+// map in the deadlocks found on earlier runs, and learn new ones in at
+// most memory bytes
+void loadPatterns(board *b, long memory)
+{
+  char name[80];
+  int x;
+
+  for (x = 0; x < MAXPOS; x++) LearnedHead[x] = -1;
+  LearnedLimit = memory/(sizeof(pattern)+sizeof(int));
+  if (LearnedLimit > MAXLEARNED) LearnedLimit = MAXLEARNED;
+  sprintf(name,PATTERNLOC,b->levelNumber);
+  Known = (pattern*)mapFile(name,levelHash(b),sizeof(pattern),
+			    &KnownCount,&KnownBytes);
+  KnownShapes = (shape*)mapFile(SHAPELOC,0,sizeof(shape),
+				&KnownShapeCount,&KnownShapeBytes);
+  fprintf(stderr,"Deadlocks: %ld patterns, %ld shared shapes on file; "
+	  "room to learn %ld\n",KnownCount,KnownShapeCount,LearnedLimit);
+}
+
+// add the deadlocks learned on this run to the files
+void savePatterns(board *b)
+{
+  char name[80];
+  pattern *all;
+  shape *shapes;
+  long n;
+
+  fprintf(stderr,"Deadlocks: %ld found in database, %ld patterns and "
+	  "%ld shapes learned\n",Hits,LearnedCount,LearnedShapeCount);
+  mkdir(SAVEDIR,0755);
+  if (LearnedCount) {
+    n = KnownCount+LearnedCount;
+    all = (pattern*)malloc(n*sizeof(pattern));
+    memcpy(all,Known,KnownCount*sizeof(pattern));
+    memcpy(all+KnownCount,Learned,LearnedCount*sizeof(pattern));
+    sprintf(name,PATTERNLOC,b->levelNumber);
+    writeFile(name,levelHash(b),all,n,sizeof(pattern),comparePatterns);
+    free(all);
+  }
+  if (LearnedShapeCount) {
+    n = KnownShapeCount+LearnedShapeCount;
+    shapes = (shape*)malloc(n*sizeof(shape));
+    memcpy(shapes,KnownShapes,KnownShapeCount*sizeof(shape));
+    memcpy(shapes+KnownShapeCount,LearnedShapes,LearnedShapeCount*sizeof(shape));
+    writeFile(SHAPELOC,0,shapes,n,sizeof(shape),compareShapes);
+    free(shapes);
+  }
+  if (Known) munmap((char*)Known-sizeof(patternFile),KnownBytes);
+  if (KnownShapes) munmap((char*)KnownShapes-sizeof(patternFile),KnownShapeBytes);
+}
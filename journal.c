@@ -0,0 +1,365 @@
+/*
+ * A journal of play, so a level may be resumed after quitting (or crashing).
+ *
+ * Each level has an append-only journal of moves, four bits apiece: a
+ * direction (NORTH..WEST) or an undo.  Moves are buffered and written (and
+ * synced to disk) in batches.  Every so often a snapshot of the level is
+ * written beside the journal: the board and the counters, and how much of
+ * the journal it accounts for.  To resume, we load the snapshot and replay
+ * only the journal written since.
+ *
+ * The undo stack lives in a file of its own, kept in step with the stack:
+ * each batch cuts the file back to the lowest depth reached since the last
+ * batch and appends the moves pushed since.  A snapshot depends on the
+ * bottom undoTop+1 entries of the file, so before those are cut it is
+ * removed, and a new one is written right after.  Resuming reads none of
+ * the stack: undo pages entries back in from the file as it reaches them,
+ * so resuming takes the same time however long the level was played.
+ *
+ * Snapshots are written to a temporary file and renamed into place, so a
+ * crash leaves either the old snapshot or the new one, never half of one.
+ * The saves directory is synced after each rename or removal, so neither
+ * is undone by a power loss.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "sokoban.h"
+
+// Journal parameters
+#define JOURNALBATCH 32   // bytes of moves (two per byte) buffered before a write
+#define SNAPEVERY 512     // moves between snapshots
+#define JOURNALMAGIC 0x536f6b31 // "Sok1": identifies our snapshots
+#define UNDOMOVE 5        // journal code for an undo (directions are 1-4)
+#define UNDOPAGE 1024     // undo entries read back from disk at a time
+
+// The header of a snapshot; followed by the rows of the level (each
+// as an int length and that many bytes)
+typedef struct snapshot_st {
+  int magic;        // JOURNALMAGIC
+  int levelNumber;  // level this is a snapshot of
+  long offset;      // bytes of journal reflected in this snapshot
+  long elapsed;     // seconds of play
+  int moveCount;    // MoveCount
+  int undoTop;      // UndoTop (the stack itself is in the undo file)
+  int worker;       // position of worker
+  int rows;         // rows in the level
+} snapshot;
+
+//
+// Global variables.
+//
+static int JournalFd = -1;                  // journal of current level
+static long JournalLen = 0;                 // bytes written to the journal
+static unsigned char JournalBuf[JOURNALBATCH]; // moves not yet written
+static int JournalMoves = 0;                // moves in JournalBuf
+static int SinceSnap = 0;                   // moves since last snapshot
+static int SnapTop = -1;                    // UndoTop of the last snapshot
+static int UndoFd = -1;                     // undo stack of current level
+static int UndoLen = 0;                     // entries in the undo file
+static int UndoLow = 0;                     // entries unchanged since written
+static int UndoPaged = 0;                   // entries below are only on disk
+static int SaveFd = -1;                     // the saves directory, for fsync
+
+/****************************************************************************
+ * Snapshots
+ */
+// write a snapshot of level l, safely replacing the old one
+static void writeSnapshot(level *l)
+{
+  char name[80], tmpName[90];
+  snapshot s[1];
+  FILE *f;
+  int r, len;
+
+  sprintf(name,SNAPLOC,l->levelNumber);
+  sprintf(tmpName,"%s.tmp",name);
+  f = fopen(tmpName,"w");
+  if (f == 0) return; // no snapshot: we'll replay a little more
+  s->magic = JOURNALMAGIC;
+  s->levelNumber = l->levelNumber;
+  s->offset = JournalLen;
+  s->elapsed = time(0)-l->startTime;
+  s->moveCount = MoveCount;
+  s->undoTop = UndoTop;
+  s->worker = l->worker;
+  s->rows = l->rows;
+  fwrite(s,sizeof(snapshot),1,f);
+  for (r = 0; r < l->rows; r++) {
+    len = strlen(l->pic[r]);
+    fwrite(&len,sizeof(int),1,f);
+    fwrite(l->pic[r],1,len,f);
+  }
+  // it must be on disk before it replaces the old one
+  if (fflush(f) || fsync(fileno(f))) {
+    fclose(f);
+    unlink(tmpName);
+    return;
+  }
+  fclose(f);
+  rename(tmpName,name);
+  if (SaveFd >= 0) fsync(SaveFd); // and so must the rename
+  SinceSnap = 0;
+  SnapTop = UndoTop;
+}
+
+// restore level l from its snapshot; returns the journal offset to replay
+// from (0 if there is no usable snapshot)
+static long readSnapshot(level *l)
+{
+  char name[80];
+  snapshot s[1];
+  FILE *f;
+  char **pic;
+  int r, len, ok = 1;
+
+  sprintf(name,SNAPLOC,l->levelNumber);
+  f = fopen(name,"r");
+  if (f == 0) return 0;
+  if (1 != fread(s,sizeof(snapshot),1,f) || s->magic != JOURNALMAGIC ||
+      s->levelNumber != l->levelNumber || s->rows != l->rows) {
+    fclose(f);
+    return 0;
+  }
+  // read the board aside: we only commit to a complete snapshot
+  pic = (char**)malloc(s->rows*sizeof(char*));
+  for (r = 0; r < s->rows; r++) pic[r] = 0;
+  for (r = 0; ok && r < s->rows; r++) {
+    ok = (1 == fread(&len,sizeof(int),1,f)) && len == strlen(l->pic[r]);
+    if (!ok) break;
+    pic[r] = (char*)malloc(len+1);
+    ok = (len == fread(pic[r],1,len,f));
+    pic[r][len] = '\0';
+  }
+  fclose(f);
+  // the undo stack must be in the undo file (it's paged in by pageUndo)
+  ok = ok && s->undoTop >= -1 && s->undoTop < UndoLen;
+  if (ok) {
+    while (s->undoTop >= MaxUndo) MaxUndo *= 2;
+    UndoStack = (int*)realloc(UndoStack,MaxUndo*sizeof(int));
+  }
+  for (r = 0; r < s->rows; r++) {
+    if (ok) {
+      free(l->pic[r]);
+      l->pic[r] = pic[r];
+    } else {
+      free(pic[r]);
+    }
+  }
+  free(pic);
+  if (!ok) return 0;
+  l->worker = s->worker;
+  l->startTime = time(0)-s->elapsed;
+  MoveCount = s->moveCount;
+  UndoTop = SnapTop = s->undoTop;
+  UndoPaged = UndoTop+1;
+  return s->offset;
+}
+
+// read the count undo entries just below UndoPaged back from the undo file;
+// returns 1 iff they were read
+static int pageIn(int count)
+{
+  long at;
+  int len;
+
+  if (count > UndoPaged) count = UndoPaged;
+  at = (UndoPaged-count)*sizeof(int);
+  len = count*sizeof(int);
+  if (UndoFd < 0 || at != lseek(UndoFd,at,SEEK_SET) ||
+      len != read(UndoFd,UndoStack+UndoPaged-count,len)) return 0;
+  UndoPaged -= count;
+  return 1;
+}
+
+// make sure the top of the undo stack is in memory (called by undo);
+// returns 0 if it couldn't be read
+int pageUndo()
+{
+  return (UndoTop < UndoPaged) ? pageIn(UNDOPAGE) : 1;
+}
+
+/****************************************************************************
+ * The journal
+ */
+// bring the undo file of level l into step with the undo stack
+static void flushUndo(level *l)
+{
+  char name[80];
+  int len = (UndoTop+1-UndoLow)*sizeof(int);
+
+  if (UndoFd < 0) return;
+  if (UndoLow < UndoLen) {
+    if (UndoLow <= SnapTop) {
+      // the snapshot is about to be wrong: drop it, and write another soon
+      sprintf(name,SNAPLOC,l->levelNumber);
+      unlink(name);
+      if (SaveFd >= 0) fsync(SaveFd); // gone for good, before the cut
+      SnapTop = -1;
+      SinceSnap = SNAPEVERY;
+    }
+    if (0 == ftruncate(UndoFd,UndoLow*sizeof(int))) UndoLen = UndoLow;
+  }
+  if (UndoLow == UndoLen && len > 0 &&
+      UndoLow*sizeof(int) == lseek(UndoFd,UndoLow*sizeof(int),SEEK_SET) &&
+      len == write(UndoFd,UndoStack+UndoLow,len)) UndoLen = UndoTop+1;
+  fsync(UndoFd);
+  if (UndoLen == UndoTop+1) UndoLow = UndoLen; // else try again next time
+}
+
+// write buffered moves to the journal and sync it to disk, along with
+// the undo stack of level l; returns 1 iff the moves are on disk
+// (if not, the journal is left as it was, and the moves stay buffered)
+static int flushJournal(level *l)
+{
+  int bytes = (JournalMoves+1)/2; // an odd move is padded with a 0 (no-op)
+  int done = 0, n;
+
+  if (JournalFd >= 0 && bytes > 0) {
+    while (done < bytes &&
+	   0 < (n = write(JournalFd,JournalBuf+done,bytes-done))) done += n;
+    if (done < bytes || fsync(JournalFd)) {
+      ftruncate(JournalFd,JournalLen); // cut off any partial batch
+      return 0;
+    }
+    JournalLen = lseek(JournalFd,0,SEEK_END);
+    memset(JournalBuf,0,sizeof(JournalBuf));
+    JournalMoves = 0;
+  }
+  flushUndo(l);
+  return 1;
+}
+
+// stop journaling the current level
+static void stopJournal()
+{
+  if (JournalFd >= 0) close(JournalFd);
+  if (UndoFd >= 0) close(UndoFd);
+  if (SaveFd >= 0) close(SaveFd);
+  JournalFd = UndoFd = SaveFd = -1;
+  JournalMoves = 0;
+  memset(JournalBuf,0,sizeof(JournalBuf));
+}
+
+// record a move (a direction, or 0 for an undo) of level l
+void journal(level *l, int move)
+{
+  if (JournalFd < 0) return;
+  if (JournalMoves == 2*JOURNALBATCH && !flushJournal(l)) {
+    // the last batch still won't go: give up, leaving the saved play
+    // as it was before that batch (but keep the undo stack whole)
+    pageIn(UndoPaged);
+    stopJournal();
+    return;
+  }
+  if (move == 0) move = UNDOMOVE;
+  JournalBuf[JournalMoves/2] |= move << (4*(JournalMoves%2));
+  JournalMoves++;
+  SinceSnap++;
+  if (UndoTop+1 < UndoLow) UndoLow = UndoTop+1;
+  if (JournalMoves == 2*JOURNALBATCH && flushJournal(l) &&
+      SinceSnap >= SNAPEVERY) writeSnapshot(l);
+}
+
+// write out everything, before we quit
+void closeJournal(level *l)
+{
+  if (JournalFd < 0) return;
+  if (flushJournal(l)) writeSnapshot(l);
+  stopJournal();
+}
+
+// the level is over: forget it, and remember to start at the next one
+// (or back at the first, after the last)
+void finishJournal(level *l)
+{
+  char name[80];
+  FILE *f;
+
+  stopJournal();
+  sprintf(name,JOURNALLOC,l->levelNumber);
+  unlink(name);
+  sprintf(name,SNAPLOC,l->levelNumber);
+  unlink(name);
+  sprintf(name,UNDOLOC,l->levelNumber);
+  unlink(name);
+  f = fopen(LEVELLOC,"w");
+  if (f) {
+    fprintf(f,"%d\n",(l->levelNumber < MAXLEVEL) ? l->levelNumber+1 : 1);
+    fclose(f);
+  }
+}
+
+// the level last played (or 1, if there is none or it makes no sense)
+int savedLevel()
+{
+  FILE *f = fopen(LEVELLOC,"r");
+  int n = 1;
+  if (f) {
+    if (1 != fscanf(f,"%d",&n)) n = 1;
+    fclose(f);
+  }
+  if (n < 0 || n > MAXLEVEL) n = 1;
+  return n;
+}
+
+// pick up level l where it was left, and start journaling it
+// (called after the level is read and displayed)
+void resume(level *l)
+{
+  char name[80];
+  unsigned char buffer[512];
+  long offset;
+  int fd, n, i, move, low;
+  FILE *f;
+
+  mkdir(SAVEDIR,0755);
+  SaveFd = open(SAVEDIR,O_RDONLY);
+  UndoPaged = 0;
+  f = fopen(LEVELLOC,"w");
+  if (f) {
+    fprintf(f,"%d\n",l->levelNumber);
+    fclose(f);
+  }
+
+  sprintf(name,UNDOLOC,l->levelNumber);
+  UndoFd = open(name,O_RDWR|O_CREAT,0644);
+  UndoLen = (UndoFd < 0) ? 0 : lseek(UndoFd,0,SEEK_END)/sizeof(int);
+  SnapTop = -1;
+
+  // jump to the latest snapshot...
+  offset = readSnapshot(l);
+  if (offset) display(l);
+  low = UndoTop+1; // the undo file is good this far
+
+  // ...and replay what came after it
+  sprintf(name,JOURNALLOC,l->levelNumber);
+  fd = open(name,O_RDONLY);
+  if (fd >= 0) {
+    lseek(fd,offset,SEEK_SET);
+    while (0 < (n = read(fd,buffer,sizeof(buffer)))) {
+      for (i = 0; i < 2*n; i++) {
+	move = (buffer[i/2] >> (4*(i%2))) & 0xf;
+	if (move == UNDOMOVE) undo(l);
+	else if (move >= NORTH && move <= WEST) go(l,move);
+	if (UndoTop+1 < low) low = UndoTop+1;
+      }
+    }
+    close(fd);
+  }
+
+  JournalFd = open(name,O_WRONLY|O_CREAT|O_APPEND,0644);
+  JournalLen = (JournalFd < 0) ? 0 : lseek(JournalFd,0,SEEK_END);
+  if (SaveFd >= 0) fsync(SaveFd); // the journal and undo files exist
+
+  JournalMoves = 0;
+  SinceSnap = 0;
+  UndoLow = low;
+  memset(JournalBuf,0,sizeof(JournalBuf));
+  updateStats(l);
+  refresh();
+}
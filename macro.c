@@ -0,0 +1,276 @@
+/*
+ * Macro moves for the sokoban solver.
+ *
+ * A little structure goes a long way.  An articulation point is a floor cell
+ * that, were it a wall, would cut the floor in two.  A tunnel cell has walls
+ * on both sides.  A box pushed onto a tunnel cell that is also an
+ * articulation point can only ever go forward (the worker can't get round
+ * it), so we keep pushing it until it leaves the tunnel.
+ *
+ * The goal room is a region holding every storage location that can only be
+ * entered through a single cell, its entrance.  We work out, once, an order
+ * in which boxes arriving at the entrance can be packed into the room, and
+ * the pushes that take each box to its spot.  The search then moves each box
+ * from the entrance to its storage location in one step, and never disturbs
+ * a box that has been packed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "solve.h"
+
+// Largest goal room we bother to plan
+#define MAXROOM 512
+
+// number cells depth-first from x, computing lowpoints (Tarjan)
+static void articulate(board *b, int x, int parent, int *num, int *low,
+		       int *counter)
+{
+  int d, y, children = 0;
+
+  num[x] = low[x] = ++*counter;
+  for (d = NORTH; d <= WEST; d++) {
+    y = b->next[x][d];
+    if (y < 0 || y == parent) continue;
+    if (num[y]) {
+      if (num[y] < low[x]) low[x] = num[y];
+      continue;
+    }
+    children++;
+    articulate(b,y,x,num,low,counter);
+    if (low[y] < low[x]) low[x] = low[y];
+    // nothing below y gets above x: x separates them from the rest
+    if (parent >= 0 && low[y] >= num[x]) b->articulation[x] = 1;
+  }
+  if (parent < 0 && children > 1) b->articulation[x] = 1;
+}
+
+// mark the cells with walls on both sides, by the axis of the corridor
+static void findTunnels(board *b)
+{
+  int x;
+  for (x = 0; x < b->cells; x++) {
+    b->tunnel[x] = 0;
+    if (b->next[x][EAST] < 0 && b->next[x][WEST] < 0) b->tunnel[x] |= 1<<NORTH;
+    if (b->next[x][NORTH] < 0 && b->next[x][SOUTH] < 0) b->tunnel[x] |= 1<<EAST;
+  }
+}
+
+// true iff a box pushed in direction dir onto cell x must keep going
+int tunnelCell(board *b, int x, int dir)
+{
+  int axis = (dir == NORTH || dir == SOUTH) ? 1<<NORTH : 1<<EAST;
+  return (b->tunnel[x] & axis) && b->articulation[x] && !b->goal[x] &&
+    x != b->entrance;
+}
+
+// mark, in mark, the cells connected to x without passing through cell cut;
+// returns the number of cells marked
+static int region(board *b, int x, int cut, char *mark)
+{
+  int *queue = b->queue;
+  int head = 0, tail = 0;
+  int d, y;
+
+  memset(mark,0,b->cells);
+  mark[x] = 1;
+  queue[tail++] = x;
+  while (head < tail) {
+    x = queue[head++];
+    for (d = NORTH; d <= WEST; d++) {
+      y = b->next[x][d];
+      if (y < 0 || y == cut || mark[y]) continue;
+      mark[y] = 1;
+      queue[tail++] = y;
+    }
+  }
+  return tail;
+}
+
+// find the shortest push path that takes a box from the entrance into the
+// room, to each storage location, given the boxes in full (the packed
+// locations); dist gets the pushes needed (-1 if impossible), and a path
+// to cell y is recovered by following via from (y,dir) back to the entrance
+static void roomPaths(board *b, char *full, int *dist, int via[][5])
+{
+  static int seen[MAXPOS][5];
+  static char wreach[MAXPOS];
+  int queue[4*MAXROOM+8], wq[MAXROOM+8];
+  int head = 0, tail = 0;
+  int x, w, y, z, d, e, wh, wt;
+
+  for (x = 0; x < b->cells; x++) {
+    dist[x] = -1;
+    for (d = 0; d < 5; d++) seen[x][d] = -1;
+  }
+  // states are (box cell, side the worker stands on); start at the door
+  seen[b->entrance][b->entryDir] = 0;
+  queue[tail++] = b->entrance*5+b->entryDir;
+  while (head < tail) {
+    x = queue[head]/5;
+    d = queue[head++]%5;
+    w = b->next[x][opposite(d)];
+    // where can the worker get to, inside the room?
+    memset(wreach,0,b->cells);
+    wreach[w] = 1;
+    wh = wt = 0;
+    wq[wt++] = w;
+    while (wh < wt) {
+      y = wq[wh++];
+      for (e = NORTH; e <= WEST; e++) {
+	z = b->next[y][e];
+	if (z < 0 || wreach[z] || z == x || full[z]) continue;
+	if (!b->room[z] && z != b->entrance) continue;
+	wreach[z] = 1;
+	wq[wt++] = z;
+      }
+    }
+    // push the box one step, in each direction we can
+    for (e = NORTH; e <= WEST; e++) {
+      w = b->next[x][opposite(e)];
+      z = b->next[x][e];
+      if (w < 0 || !wreach[w] || z < 0 || !b->room[z] || full[z]) continue;
+      if (seen[z][e] >= 0) continue;
+      seen[z][e] = seen[x][d]+1;
+      via[z][e] = d;
+      if (dist[z] < 0) dist[z] = seen[z][e];
+      queue[tail++] = z*5+e;
+    }
+  }
+  // leave, in via[y][0], the direction of the last push of a shortest path
+  for (x = 0; x < b->cells; x++) {
+    if (dist[x] < 0) continue;
+    for (d = NORTH; d <= WEST; d++) {
+      if (seen[x][d] == dist[x]) { via[x][0] = d; break; }
+    }
+  }
+}
+
+// choose an order to pack the room, by emptying it one box at a time
+// returns 1 iff every storage location can be filled
+static int planRoom(board *b)
+{
+  static int via[MAXPOS][5];
+  int dist[MAXPOS];
+  char full[MAXPOS];
+  int k, x, y, d, e, best, len;
+
+  memset(full,0,b->cells);
+  for (x = 0; x < b->cells; x++) {
+    if (b->goal[x]) full[x] = 1;
+  }
+  // the last box in is the easiest to take out
+  for (k = b->roomGoals-1; k >= 0; k--) {
+    best = -1;
+    for (x = 0; x < b->cells; x++) {
+      if (!full[x]) continue;
+      full[x] = 0;
+      roomPaths(b,full,dist,via);
+      full[x] = 1;
+      if (dist[x] > 0 && (best < 0 || dist[x] < dist[best])) best = x;
+    }
+    if (best < 0) return 0;
+    full[best] = 0;
+    roomPaths(b,full,dist,via);
+    // walk the path back to the entrance, writing it out back to front
+    len = dist[best];
+    b->order[k] = best;
+    b->roomPath[k] = (char*)malloc(len+1);
+    b->roomPath[k][len] = '\0';
+    y = best;
+    d = via[best][0];
+    while (len) {
+      b->roomPath[k][--len] = d;
+      e = via[y][d];
+      y = b->next[y][opposite(d)];
+      d = e;
+    }
+    assert(y == b->entrance);
+  }
+  return 1;
+}
+
+// drop the symmetries that would scramble the packing order of the room
+static void keepSymmetries(board *b)
+{
+  int t, k, n = 1;
+  for (t = 1; t < b->symmetries; t++) {
+    if (b->map[t][b->entrance] != b->entrance) continue;
+    for (k = 0; k < b->roomGoals; k++) {
+      if (b->map[t][b->order[k]] != b->order[k]) break;
+    }
+    if (k < b->roomGoals) continue;
+    if (t != n) memcpy(b->map[n],b->map[t],sizeof(b->map[t]));
+    n++;
+  }
+  b->symmetries = n;
+}
+
+// look for a goal room: the smallest region with all the storage and no
+// boxes that hangs off a single articulation point
+static void findRoom(board *b)
+{
+  char mark[MAXPOS], best[MAXPOS];
+  int bestSize = 0, bestDir = 0, bestDoor = -1;
+  int x, y, d, i, size, inside;
+
+  if (b->goals != b->boxes) return; // spare storage: packing isn't forced
+  for (x = 0; x < b->cells; x++) {
+    if (!b->articulation[x] || b->goal[x]) continue;
+    for (d = NORTH; d <= WEST; d++) {
+      y = b->next[x][d];
+      if (y < 0 || b->next[x][opposite(d)] < 0) continue;
+      size = region(b,y,x,mark);
+      if (size > MAXROOM || (bestDoor >= 0 && size >= bestSize)) continue;
+      // the room must hold all the storage, and be empty at the start
+      for (i = 0; i < b->cells; i++) {
+	if (b->goal[i] && !mark[i]) break;
+	if (mark[i] && i == b->start[0]) break;
+      }
+      if (i < b->cells) continue;
+      for (i = 1; i <= b->boxes; i++) {
+	if (mark[b->start[i]]) break;
+      }
+      if (i <= b->boxes) continue;
+      // and the door must open onto a single cell of the room
+      for (inside = 0, i = NORTH; i <= WEST; i++) {
+	if (b->next[x][i] >= 0 && mark[b->next[x][i]]) inside++;
+      }
+      if (inside != 1) continue;
+      memcpy(best,mark,b->cells);
+      bestSize = size;
+      bestDoor = x;
+      bestDir = d;
+    }
+  }
+  if (bestDoor < 0) return;
+
+  memcpy(b->room,best,b->cells);
+  b->entrance = bestDoor;
+  b->entryDir = bestDir;
+  b->roomGoals = b->goals;
+  if (!planRoom(b)) {
+    // no order packs the room: forget it
+    memset(b->room,0,b->cells);
+    b->entrance = -1;
+    b->roomGoals = 0;
+  }
+}
+
+// find articulation points, tunnels and the goal room, and plan the macro
+// moves they allow (called once, after analyze)
+void findMacros(board *b)
+{
+  int num[MAXPOS], low[MAXPOS];
+  int counter = 0;
+
+  memset(num,0,sizeof(num));
+  memset(b->articulation,0,b->cells);
+  b->entrance = -1;
+  articulate(b,b->start[0],-1,num,low,&counter);
+  findTunnels(b);
+  findRoom(b);
+  if (b->roomGoals) keepSymmetries(b);
+  b->macros = 1;
+}
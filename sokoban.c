@@ -62,6 +62,7 @@ level *readLevel(int n)
   char levelName[80];
   level *result;
   char buffer[80];
+  int maxRows = 25; // initial allocation of rows (extended as needed)
   int r, c;
 
   // attempt to open the level
@@ -79,7 +80,7 @@ level *readLevel(int n)
   result->levelNumber = n;
   result->rows = 0;
   result->cols = 0;
-  result->pic = (char**)malloc(MAXROWS*sizeof(char*));
+  result->pic = (char**)malloc(maxRows*sizeof(char*));
   result->worker = 0;
 
   // read in the rows
@@ -90,7 +91,11 @@ level *readLevel(int n)
       buffer[l-1] = '\0';
       l--;
     }
-    // copy into picture array
+    // copy into picture array, possibly extending it
+    if (result->rows >= maxRows) {
+      maxRows *= 2;
+      result->pic = (char **)realloc(result->pic, maxRows*sizeof(char*));
+    }
     result->pic[result->rows] = strdup(buffer);
     result->rows++;
     if (l > result->cols) result->cols = l;
@@ -108,7 +113,9 @@ level *readLevel(int n)
   // SPACE is set if this is a possible location for the worker
   // WALL is set if this is a wall (#); nothing can go here
   for (r = 0; r < result->rows; r++) {
-    for (c = 0; c < result->cols; c++) {
+    // lines are variable length; stop at the end of this one
+    int lineLen = strlen(result->pic[r]);
+    for (c = 0; c < lineLen; c++) {
       int p = rc2p(r,c);
       char ch = result->pic[r][c];
       if (ch == '@') {
@@ -189,13 +196,14 @@ int play(level *l)
     do {
       switch (ch) {
 	// basic motion: take emacs or, god forbid, arrow keys
-      case CTRL('B'): if (!go(l,WEST)) repeatCount = 0; break;
-      case CTRL('F'): if (!go(l,EAST)) repeatCount = 0; break;
-      case CTRL('N'): if (!go(l,SOUTH)) repeatCount = 0; break;
-      case CTRL('P'): if (!go(l,NORTH)) repeatCount = 0; break;
+	// (each move made is recorded in the journal)
+      case CTRL('B'): if (go(l,WEST)) journal(l,WEST); else repeatCount = 0; break;
+      case CTRL('F'): if (go(l,EAST)) journal(l,EAST); else repeatCount = 0; break;
+      case CTRL('N'): if (go(l,SOUTH)) journal(l,SOUTH); else repeatCount = 0; break;
+      case CTRL('P'): if (go(l,NORTH)) journal(l,NORTH); else repeatCount = 0; break;
 
 	// undo last move
-      case CTRL('_'): if (!undo(l)) repeatCount = 0; break;
+      case CTRL('_'): if (undo(l)) journal(l,0); else repeatCount = 0; break;
 
 	// the boss key (not repeatable)
       case ' ': OMG(l); repeatCount = 0; break;
@@ -210,8 +218,9 @@ int play(level *l)
 	prefix = 1;
 	break;
 
-	// loser key: quit puzzle
+	// loser key: quit puzzle (it may be resumed later)
       case CTRL('G'):
+	  closeJournal(l);
 	  shutdown();
 	  exit(0);
 
@@ -222,6 +231,7 @@ int play(level *l)
 
       // check for win; if a win, indicate message, read a key, end play
       if (win(l)) {
+	finishJournal(l);
 	updateStats(l);
 	message("YOU WIN! (Press 'g' for next level.)");
 	refresh();
@@ -467,7 +477,7 @@ int undo(level *l)
 {
   int p;
   int pull;
-  if (UndoTop < 0) return 0;
+  if (UndoTop < 0 || !pageUndo()) return 0;
   
   // grab last move
   p = UndoStack[UndoTop--];
@@ -612,8 +622,11 @@ int main(int argc, char **argv)
   int currentLevelNumber;
   level *currentLevel;
 
+  // solver mode: sokoban --solve [options] [level]
+  if (argc > 1 && 0 == strcmp(argv[1],"--solve")) return solve(argc-1,argv+1);
+
   if (argc > 1) currentLevelNumber = atoi(argv[1]);
-  else currentLevelNumber = 1;
+  else currentLevelNumber = savedLevel(); // where we left off
 
   // start the curses screen manager
   initialize();
@@ -622,6 +635,7 @@ int main(int argc, char **argv)
   while (currentLevelNumber <= MAXLEVEL) {
     currentLevel = readLevel(currentLevelNumber);
     display(currentLevel);
+    resume(currentLevel);
     play(currentLevel);
     currentLevelNumber++;
   }
@@ -34,6 +34,12 @@ typedef struct level_st {
 #define SCREENLOC "screens/screen.%d"
 #define HELPSCREEN "screens/HELP"
 #define OMGSCREEN "screens/WORK"
+// Saved games (see journal.c):
+#define SAVEDIR "saves"
+#define JOURNALLOC "saves/journal.%d"
+#define SNAPLOC "saves/snap.%d"
+#define UNDOLOC "saves/undo.%d"
+#define LEVELLOC "saves/level"
 
 // Number of different puzzle levels
 // (you can start sokoban at a particular level with sokoban <levelnumber>)
@@ -68,24 +74,31 @@ extern int MoveCount;   // number of moves (currently 1+UndoTop)
  * (The extern keyword means "if code not found here, the look outside".)
  */
 
-// (see documentation in sokoban.c)
+// (see documentation in sokoban.c, journal.c and solve.c)
+extern void closeJournal(level *l);
 extern void display(level *l);
+extern void finishJournal(level *l);
 extern char get(level *l, int row, int col);
 extern int go(level *l, int direction);
 extern int height(level *l);
 extern void help();
 extern void highlight(level *l, int row, int col);
 extern void initialize();
+extern void journal(level *l, int move);
 extern void message(char *msg);
 extern void movePiece(level *l, int r0, int c0, int r1, int c1);
 extern void mvstr(int r, int c, char *s);
 extern void OMG(level *l);
 extern void p2rc(int p, int *r, int *c);
+extern int pageUndo();
 extern int play(level *);
 extern void pushMove(int m);
 extern int rc2p(int r, int c);
-extern level *readlevel(int n);
+extern level *readLevel(int n);
+extern void resume(level *l);
+extern int savedLevel();
 extern void shutdown();
+extern int solve(int argc, char **argv);
 extern int undo(level *l);
 extern void update(level*l, int r, int c);
 extern void updateStats(level *l);
@@ -0,0 +1,791 @@
+/*
+ * A sokoban solver that keeps its search on disk.
+ *
+ * The solver explores the level breadth-first, one push at a time.  Levels
+ * whose state spaces exceed memory are handled by delayed duplicate
+ * detection: the children of a layer are gathered into a buffer no larger
+ * than the memory limit, sorted, and written out as a run.  The runs are
+ * then merged with the (sorted) file of every state visited so far; states
+ * not seen before become the next layer.  All file I/O is sequential.
+ *
+ * Run it with:
+ *   sokoban --solve [--mem-limit size] [--tmp-dir dir] [--no-macros] [level]
+ *
+ * Unless --no-macros is given, tunnel and goal room macros (see macro.c)
+ * make the search graph much smaller; the solutions found are then no
+ * longer sure to use the fewest pushes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <signal.h>
+#include <dirent.h>
+#include "solve.h"
+
+// Tunable parameters of the external search
+#define MEMLIMIT (256L<<20) // default memory limit, in bytes
+#define IOBUF (1<<16)       // bytes of buffering for each open file
+#define FANIN 16            // most runs merged at once
+#define PATTERNSHARE 8      // 1/8 of memory goes to learned deadlocks
+#define TMPDIR "/tmp"       // default location for search files
+
+// Letters used to print moves (pushes are capitalized), by direction
+#define MOVES " urdl"
+
+// A sorted file of states, read one state at a time
+typedef struct stream_st {
+  FILE *f;
+  char *buf;                   // stdio buffer
+  unsigned short s[MAXBOX+1];  // current state
+  int live;                    // 1 iff s is valid
+} stream;
+
+//
+// Global variables.
+//
+static int StateSize;        // bytes in a state (for qsort)
+static char WorkDir[256];    // directory holding search files
+static char *Solution;       // moves of the solution, as printed
+static int SolutionLen = 0;  // number of moves in Solution
+static int MaxSolution = 0;  // allocation of Solution
+
+/****************************************************************************
+ * Analysis of the level
+ */
+// return the direction opposite dir
+int opposite(int dir)
+{
+  return (dir+1)%4+1;
+}
+
+// true iff every box is in storage
+int solved(board *b, unsigned short *s)
+{
+  int i;
+  for (i = 1; i <= b->boxes; i++) {
+    if (!b->goal[s[i]]) return 0;
+  }
+  return 1;
+}
+
+// mark the cells of a level, from a position (used in analyze, only)
+static void markFloor(level *l, char *inside, int r, int c)
+{
+  if (r < 0 || c < 0 || r >= l->rows || c >= l->cols) return;
+  if (inside[rc2p(r,c)] || (WALL & get(l,r,c))) return;
+  inside[rc2p(r,c)] = 1;
+  markFloor(l,inside,r-1,c);
+  markFloor(l,inside,r,c+1);
+  markFloor(l,inside,r+1,c);
+  markFloor(l,inside,r,c-1);
+}
+
+// compute the static description of a level, read with readLevel
+board *analyze(level *l)
+{
+  board *b;
+  char inside[MAXPOS];
+  int dr[] = { 0, -1, 0, 1, 0 };
+  int dc[] = { 0, 0, 1, 0, -1 };
+  int r, c, d, p, x, y, n;
+  int *queue;
+
+  if (l->rows > 64 || l->cols > 64) {
+    fprintf(stderr,"Level %d is too large to solve\n",l->levelNumber);
+    exit(1);
+  }
+  b = (board *)calloc(1,sizeof(board));
+  assert(b);
+  b->levelNumber = l->levelNumber;
+  b->rows = l->rows;
+  b->cols = l->cols;
+
+  // the floor is everything the worker could reach, if there were no boxes
+  memset(inside,0,sizeof(inside));
+  p2rc(l->worker,&r,&c);
+  markFloor(l,inside,r,c);
+
+  // number the floor cells in reading order
+  for (p = 0; p < MAXPOS; p++) b->cell[p] = -1;
+  for (r = 0; r < b->rows; r++) {
+    for (c = 0; c < b->cols; c++) {
+      p = rc2p(r,c);
+      if (!inside[p]) {
+	// a box we can never reach had better be stored already
+	if ((get(l,r,c) & (BOX|STORE)) == BOX) {
+	  fprintf(stderr,"Level %d has a box out of reach\n",l->levelNumber);
+	  exit(1);
+	}
+	continue;
+      }
+      b->cell[p] = b->cells;
+      b->pos[b->cells] = p;
+      b->cells++;
+    }
+  }
+
+  // link neighbours, note the storage locations and find the boxes
+  for (x = 0; x < b->cells; x++) {
+    p2rc(b->pos[x],&r,&c);
+    for (d = NORTH; d <= WEST; d++) {
+      b->next[x][d] = -1;
+      if (r+dr[d] < 0 || c+dc[d] < 0 || r+dr[d] >= 64 || c+dc[d] >= 64) continue;
+      if (inside[rc2p(r+dr[d],c+dc[d])])
+	b->next[x][d] = b->cell[rc2p(r+dr[d],c+dc[d])];
+    }
+    b->goal[x] = (STORE & get(l,r,c)) != 0;
+    b->goals += b->goal[x];
+    if (BOX & get(l,r,c)) {
+      if (b->boxes == MAXBOX) {
+	fprintf(stderr,"Level %d has too many boxes to solve\n",l->levelNumber);
+	exit(1);
+      }
+      b->start[1+b->boxes++] = x;
+    }
+  }
+  b->start[0] = b->cell[l->worker];
+  b->entrance = -1;
+  b->stateSize = (1+b->boxes)*sizeof(unsigned short);
+
+  // a cell is live if a box there could be pushed to some storage location;
+  // we find these by pulling boxes away from storage
+  queue = b->queue;
+  n = 0;
+  for (x = 0; x < b->cells; x++) {
+    b->dead[x] = !b->goal[x];
+    if (b->goal[x]) queue[n++] = x;
+  }
+  while (n) {
+    x = queue[--n];
+    for (d = NORTH; d <= WEST; d++) {
+      y = b->next[x][d];
+      if (y < 0 || !b->dead[y] || b->next[y][d] < 0) continue;
+      b->dead[y] = 0;
+      queue[n++] = y;
+    }
+  }
+  findSymmetries(b);
+  return b;
+}
+
+/****************************************************************************
+ * Moves
+ */
+// mark (on = 1) or clear (on = 0) the boxes of state s in the board
+void placeBoxes(board *b, unsigned short *s, int on)
+{
+  int i;
+  for (i = 1; i <= b->boxes; i++) b->boxAt[s[i]] = on ? i : 0;
+}
+
+// take a fresh mark for b->reach, starting over when the count wraps
+static void newReach(board *b)
+{
+  if (++b->reachMark == 0) {
+    memset(b->reach,0,sizeof(b->reach));
+    b->reachMark = 1;
+  }
+}
+
+// mark the cells the worker can reach from cell from, avoiding boxes
+// (placeBoxes must have been called); returns the number of cells reached
+int flood(board *b, int from)
+{
+  int head = 0, tail = 0;
+  int x, y, d;
+
+  newReach(b);
+  b->reach[from] = b->reachMark;
+  b->queue[tail++] = from;
+  while (head < tail) {
+    x = b->queue[head++];
+    for (d = NORTH; d <= WEST; d++) {
+      y = b->next[x][d];
+      if (y < 0 || b->boxAt[y] || b->reach[y] == b->reachMark) continue;
+      b->reach[y] = b->reachMark;
+      b->queue[tail++] = y;
+    }
+  }
+  return tail;
+}
+
+// build, in kid, the state s with box i pushed to cell to, leaving the
+// worker at cell worker
+static void pushBox(board *b, unsigned short *s, int i, int to, int worker,
+		    unsigned short *kid)
+{
+  memcpy(kid,s,b->stateSize);
+  kid[0] = worker;
+  // slide the box along until the boxes are in order again
+  while (i > 1 && kid[i-1] > to) { kid[i] = kid[i-1]; i--; }
+  while (i < b->boxes && kid[i+1] < to) { kid[i] = kid[i+1]; i++; }
+  kid[i] = to;
+}
+
+// compute the states reachable from s by a single push (or macro move)
+// kids must hold MAXKIDS states; the edge to each is recorded in how
+// returns the number of children generated
+int expand(board *b, unsigned short *s, unsigned short *kids, edge *how)
+{
+  int n = 0;
+  int width = 1+b->boxes;
+  int packed = 0;
+  int i, d, x, from, to, pushes, corral, dead;
+  char *path;
+
+  placeBoxes(b,s,1);
+  flood(b,s[0]);
+  // a PI-corral limits us to pushes into it (or shows s is hopeless)
+  corral = b->corrals ? findCorral(b,s) : 0;
+  if (corral < 0) {
+    placeBoxes(b,s,0);
+    return 0;
+  }
+  for (i = 1; i <= b->boxes; i++) packed += b->room[s[i]];
+  for (i = 1; i <= b->boxes; i++) {
+    x = s[i];
+    if (b->room[x]) continue; // packed away for good
+    for (d = NORTH; d <= WEST; d++) {
+      from = b->next[x][opposite(d)];
+      to = b->next[x][d];
+      // the worker must get behind the box, and the box have somewhere to go
+      if (from < 0 || b->reach[from] != b->reachMark) continue;
+      if (to < 0 || b->boxAt[to] || b->dead[to]) continue;
+      if (corral && (b->corral[x] != b->corralChosen ||
+		     b->corral[to] != b->corralChosen)) continue;
+      pushes = 1;
+      path = 0;
+      if (x == b->entrance && d == b->entryDir && packed < b->roomGoals) {
+	// into the goal room: straight to the next storage location
+	path = b->roomPath[packed];
+	pushes = strlen(path);
+	to = b->order[packed];
+	from = b->next[to][opposite(path[pushes-1])];
+      } else if (b->macros) {
+	// through a tunnel: keep going until the box comes out
+	while (tunnelCell(b,to,d) && b->next[to][d] >= 0 &&
+	       !b->boxAt[b->next[to][d]] && !b->dead[b->next[to][d]]) {
+	  to = b->next[to][d];
+	  pushes++;
+	}
+	from = b->next[to][opposite(d)];
+      } else {
+	from = x;
+      }
+      if (b->patterns) {
+	// look for frozen boxes, with the box in its new place
+	b->boxAt[x] = 0;
+	b->boxAt[to] = i;
+	dead = deadlocked(b,to);
+	b->boxAt[to] = 0;
+	b->boxAt[x] = i;
+	if (dead) continue;
+      }
+      pushBox(b,s,i,to,from,kids+n*width);
+      how[n].box = x;
+      how[n].dir = d;
+      how[n].pushes = pushes;
+      how[n].path = path;
+      n++;
+    }
+  }
+  placeBoxes(b,s,0);
+  return n;
+}
+
+/****************************************************************************
+ * Printing solutions
+ */
+// append a move to the solution, possibly extending it
+static void record(char ch)
+{
+  if (SolutionLen+1 >= MaxSolution) {
+    MaxSolution = MaxSolution ? 2*MaxSolution : 256;
+    Solution = (char*)realloc(Solution,MaxSolution);
+  }
+  Solution[SolutionLen++] = ch;
+  Solution[SolutionLen] = '\0';
+}
+
+// walk the worker of s behind the box at cell box, and push it once in
+// direction dir; s is updated to reflect the push
+static void recordPush(board *b, unsigned short *s, int box, int dir)
+{
+  unsigned short kid[MAXBOX+1];
+  int via[MAXPOS];
+  char path[MAXPOS];
+  int head = 0, tail = 0, len = 0;
+  int x, y, d, i;
+  int target = b->next[box][opposite(dir)];
+
+  // breadth-first search from the worker, remembering how we got there
+  placeBoxes(b,s,1);
+  newReach(b);
+  b->reach[s[0]] = b->reachMark;
+  b->queue[tail++] = s[0];
+  while (head < tail && b->reach[target] != b->reachMark) {
+    x = b->queue[head++];
+    for (d = NORTH; d <= WEST; d++) {
+      y = b->next[x][d];
+      if (y < 0 || b->boxAt[y] || b->reach[y] == b->reachMark) continue;
+      b->reach[y] = b->reachMark;
+      via[y] = d;
+      b->queue[tail++] = y;
+    }
+  }
+  assert(b->reach[target] == b->reachMark);
+  for (x = target; x != s[0]; x = b->next[x][opposite(via[x])]) {
+    path[len++] = MOVES[via[x]];
+  }
+  while (len) record(path[--len]);
+  record(MOVES[dir]-'a'+'A');
+
+  // now make the push
+  i = b->boxAt[box];
+  placeBoxes(b,s,0);
+  memcpy(kid,s,b->stateSize);
+  pushBox(b,kid,i,b->next[box][dir],box,s);
+}
+
+// record the moves that walk along edge e from state s
+static void recordEdge(board *b, unsigned short *s, edge *e)
+{
+  int box = e->box;
+  int i, d;
+  for (i = 0; i < e->pushes; i++) {
+    d = e->path ? e->path[i] : e->dir;
+    recordPush(b,s,box,d);
+    box = b->next[box][d];
+  }
+}
+
+/****************************************************************************
+ * Search files
+ */
+// compare two states (for qsort and merging)
+static int compareStates(const void *a, const void *b)
+{
+  return memcmp(a,b,StateSize);
+}
+
+// remove every search file, and the work directory itself
+static void removeWorkDir()
+{
+  char name[300];
+  struct dirent *e;
+  DIR *d;
+
+  if (WorkDir[0] == '\0') return;
+  d = opendir(WorkDir);
+  if (d) {
+    while ((e = readdir(d))) {
+      if (strncmp(e->d_name,"layer.",6) && strncmp(e->d_name,"visited.",8) &&
+	  strncmp(e->d_name,"run.",4)) continue;
+      sprintf(name,"%s/%.40s",WorkDir,e->d_name);
+      unlink(name);
+    }
+    closedir(d);
+  }
+  rmdir(WorkDir);
+  WorkDir[0] = '\0';
+}
+
+// interrupted: clean up, then die of the signal as we would have
+static void interrupted(int sig)
+{
+  removeWorkDir();
+  signal(sig,SIG_DFL);
+  raise(sig);
+}
+
+// compute the name of search file kind.n
+static char *fileName(char *kind, int n)
+{
+  static char name[300];
+  sprintf(name,"%s/%s.%d",WorkDir,kind,n);
+  return name;
+}
+
+// open a search file with a large buffer (NULL buf: let stdio allocate)
+static FILE *openFile(char *kind, int n, char *mode, char *buf)
+{
+  FILE *f = fopen(fileName(kind,n),mode);
+  if (f == 0) {
+    fprintf(stderr,"Could not open file %s\n",fileName(kind,n));
+    removeWorkDir();
+    exit(1);
+  }
+  setvbuf(f,buf,_IOFBF,IOBUF);
+  return f;
+}
+
+// write a state to a search file
+static void writeState(FILE *f, unsigned short *s)
+{
+  if (1 != fwrite(s,StateSize,1,f)) {
+    fprintf(stderr,"Could not write search file (disk full?)\n");
+    removeWorkDir();
+    exit(1);
+  }
+}
+
+// read the next state of a stream; returns 1 iff there was one
+static int advance(stream *in)
+{
+  in->live = (1 == fread(in->s,StateSize,1,in->f));
+  return in->live;
+}
+
+// open stream on search file kind.n, and read its first state
+static void openStream(stream *in, char *kind, int n, char *buf)
+{
+  in->buf = buf;
+  in->f = openFile(kind,n,"r",buf);
+  advance(in);
+}
+
+// close a stream, removing its file
+static void closeStream(stream *in, char *kind, int n)
+{
+  fclose(in->f);
+  unlink(fileName(kind,n));
+}
+
+// sort and write count states of buf as run n, dropping repeats
+static void writeRun(char *buf, long count, int n, char *iobuf)
+{
+  FILE *f = openFile("run",n,"w",iobuf);
+  long i;
+  qsort(buf,count,StateSize,compareStates);
+  for (i = 0; i < count; i++) {
+    if (i && 0 == compareStates(buf+(i-1)*StateSize,buf+i*StateSize)) continue;
+    writeState(f,(unsigned short*)(buf+i*StateSize));
+  }
+  fclose(f);
+}
+
+// remove the least state from k sorted streams into s, skipping any state
+// already returned (*primed is true once s holds a state); returns 0 at end
+static int nextUnique(stream *in, int k, unsigned short *s, int *primed)
+{
+  int i, m;
+  for (;;) {
+    m = -1;
+    for (i = 0; i < k; i++) {
+      if (in[i].live && (m < 0 || compareStates(in[i].s,in[m].s) < 0)) m = i;
+    }
+    if (m < 0) return 0;
+    if (*primed && 0 == compareStates(in[m].s,s)) {
+      advance(&in[m]);
+      continue;
+    }
+    memcpy(s,in[m].s,StateSize);
+    *primed = 1;
+    advance(&in[m]);
+    return 1;
+  }
+}
+
+// merge runs first..first+k-1 into run out, removing the inputs
+static void mergeRuns(int first, int k, int out, char *iobufs)
+{
+  stream in[FANIN];
+  unsigned short s[MAXBOX+1];
+  int primed = 0;
+  int i;
+  FILE *f = openFile("run",out,"w",iobufs);
+
+  for (i = 0; i < k; i++) openStream(&in[i],"run",first+i,iobufs+(i+1)*IOBUF);
+  while (nextUnique(in,k,s,&primed)) writeState(f,s);
+  for (i = 0; i < k; i++) closeStream(&in[i],"run",first+i);
+  fclose(f);
+}
+
+// merge runs first..last-1 with visited.v, writing new states to layer
+// depth and all states to visited.(v+1); returns the size of the new layer
+static long mergeLayer(int first, int last, int depth, int v, long *visited,
+		       char *iobufs)
+{
+  stream in[FANIN], old;
+  unsigned short s[MAXBOX+1];
+  int primed = 0;
+  long count = 0;
+  int i, k, cmp = 0;
+  FILE *layer, *all;
+
+  // too many runs to merge at once: merge them in groups, first
+  while (last-first > FANIN) {
+    int next = last;
+    for (i = first; i < last; i += FANIN) {
+      k = (last-i < FANIN) ? last-i : FANIN;
+      mergeRuns(i,k,next++,iobufs);
+    }
+    first = last;
+    last = next;
+  }
+
+  k = last-first;
+  for (i = 0; i < k; i++) openStream(&in[i],"run",first+i,iobufs+i*IOBUF);
+  openStream(&old,"visited",v,iobufs+FANIN*IOBUF);
+  layer = openFile("layer",depth,"w",iobufs+(FANIN+1)*IOBUF);
+  all = openFile("visited",v+1,"w",iobufs+(FANIN+2)*IOBUF);
+  while (nextUnique(in,k,s,&primed)) {
+    // copy over visited states that come first
+    while (old.live && (cmp = compareStates(old.s,s)) < 0) {
+      writeState(all,old.s);
+      advance(&old);
+    }
+    if (old.live && cmp == 0) continue; // seen before
+    writeState(layer,s);
+    writeState(all,s);
+    count++;
+  }
+  while (old.live) {
+    writeState(all,old.s);
+    advance(&old);
+  }
+  for (i = 0; i < k; i++) closeStream(&in[i],"run",first+i);
+  closeStream(&old,"visited",v);
+  fclose(layer);
+  fclose(all);
+  *visited += count;
+  return count;
+}
+
+/****************************************************************************
+ * Search
+ */
+// find, in layer depth, a parent of canonical state target; copy it to target
+static void findParent(board *b, int depth, unsigned short *target, char *iobuf)
+{
+  unsigned short kids[MAXKIDS*(MAXBOX+1)];
+  edge how[MAXKIDS];
+  stream in;
+  int i, n;
+  int width = 1+b->boxes;
+
+  openStream(&in,"layer",depth,iobuf);
+  for (; in.live; advance(&in)) {
+    n = expand(b,in.s,kids,how);
+    for (i = 0; i < n; i++) {
+      canonical(b,kids+i*width);
+      if (0 == compareStates(kids+i*width,target)) break;
+    }
+    if (i < n) break;
+  }
+  assert(in.live);
+  memcpy(target,in.s,StateSize);
+  fclose(in.f);
+}
+
+// print the moves that lead along chain, from the initial state
+// chain holds canonical states; the actual states are images of these
+static void printSolution(board *b, unsigned short *chain, int depth)
+{
+  unsigned short kids[MAXKIDS*(MAXBOX+1)];
+  unsigned short s[MAXBOX+1], kid[MAXBOX+1];
+  edge how[MAXKIDS];
+  int width = 1+b->boxes;
+  int pushes = 0;
+  int k, i, n;
+
+  // the corral chosen in a state may differ from the one chosen in its
+  // mirror image, so we follow the chain using all the pushes
+  b->corrals = 0;
+  memcpy(s,b->start,StateSize);
+  for (k = 0; k < depth; k++) {
+    n = expand(b,s,kids,how);
+    for (i = 0; i < n; i++) {
+      memcpy(kid,kids+i*width,StateSize);
+      canonical(b,kid);
+      if (0 == compareStates(kid,chain+(k+1)*width)) break;
+    }
+    assert(i < n);
+    pushes += how[i].pushes;
+    recordEdge(b,s,&how[i]);
+  }
+  printf("Level %d: solved in %d pushes, %d moves\n",
+	 b->levelNumber,pushes,SolutionLen);
+  printf("%s\n",SolutionLen ? Solution : "");
+}
+
+// search breadth-first from the initial state, using at most memLimit bytes
+// of buffer; returns 1 iff the level was solved
+static int search(board *b, long memLimit)
+{
+  unsigned short kids[MAXKIDS*(MAXBOX+1)];
+  unsigned short *chain = 0;
+  edge how[MAXKIDS];
+  stream in;
+  char *iobufs, *buf;
+  long capacity, count;
+  long layerSize = 1, visited = 1;
+  int width = 1+b->boxes;
+  int depth, runs, i, n, k;
+  int goal = -1;
+  FILE *f;
+
+  // the rest of memory (checked by solve) goes to the buffer of children
+  iobufs = (char*)malloc((FANIN+3)*IOBUF);
+  capacity = (memLimit-(FANIN+3)*IOBUF)/StateSize;
+  buf = (char*)malloc(capacity*StateSize);
+  if (iobufs == 0 || buf == 0) {
+    fprintf(stderr,"Could not allocate %ld bytes\n",memLimit);
+    removeWorkDir();
+    exit(1);
+  }
+
+  // layer 0 is the initial state
+  memcpy(kids,b->start,StateSize);
+  canonical(b,kids);
+  f = openFile("layer",0,"w",iobufs); writeState(f,kids); fclose(f);
+  f = openFile("visited",0,"w",iobufs); writeState(f,kids); fclose(f);
+  if (solved(b,b->start)) goal = 0;
+
+  for (depth = 0; goal < 0 && layerSize; depth++) {
+    // expand layer depth into sorted runs
+    runs = 0;
+    count = 0;
+    openStream(&in,"layer",depth,iobufs);
+    for (; in.live; advance(&in)) {
+      n = expand(b,in.s,kids,how);
+      for (i = 0; i < n; i++) {
+	canonical(b,kids+i*width);
+	if (!solved(b,kids+i*width)) continue;
+	// found it: this layer holds the parent
+	goal = depth+1;
+	chain = (unsigned short*)malloc((goal+1)*StateSize);
+	memcpy(chain+goal*width,kids+i*width,StateSize);
+	memcpy(chain+depth*width,in.s,StateSize);
+	break;
+      }
+      if (goal >= 0) break;
+      if (count+n > capacity) {
+	writeRun(buf,count,runs++,iobufs+IOBUF);
+	count = 0;
+      }
+      memcpy(buf+count*StateSize,kids,n*StateSize);
+      count += n;
+    }
+    fclose(in.f);
+    if (goal >= 0) {
+      // clean up partial runs
+      for (k = 0; k < runs; k++) unlink(fileName("run",k));
+      break;
+    }
+    if (count) writeRun(buf,count,runs++,iobufs+IOBUF);
+
+    // remove duplicates: the new layer is what was never visited
+    layerSize = mergeLayer(0,runs,depth+1,depth,&visited,iobufs);
+    fprintf(stderr,"Depth %d: %ld new states, %ld visited\n",
+	    depth+1,layerSize,visited);
+  }
+  free(buf);
+
+  if (goal < 0 && b->macros) {
+    // macro moves skip positions, so this proves nothing
+    printf("Level %d: no solution found with macro moves (%ld positions).\n",
+	   b->levelNumber,visited);
+    printf("Try --no-macros for a complete search.\n");
+  } else if (goal < 0) {
+    printf("Level %d: no solution.\n",b->levelNumber);
+    printf("All %ld positions reachable in %d pushes were searched.\n",
+	   visited,depth-1);
+  } else {
+    // walk back through the layers to the initial state
+    for (k = goal-2; k >= 0; k--) {
+      memcpy(chain+k*width,chain+(k+1)*width,StateSize);
+      findParent(b,k,chain+k*width,iobufs);
+    }
+    printSolution(b,chain,goal);
+    free(chain);
+  }
+  free(iobufs);
+  return goal >= 0;
+}
+
+// parse a size, like 512M; returns bytes, or -1 on error
+static long parseSize(char *arg)
+{
+  char *end;
+  long size = strtol(arg,&end,10);
+  switch (*end) {
+  case 'g': case 'G': size <<= 10; // fall through
+  case 'm': case 'M': size <<= 10; // fall through
+  case 'k': case 'K': size <<= 10; end++; break;
+  }
+  if (*end || size <= 0) return -1;
+  return size;
+}
+
+// the solver's main method: sokoban --solve [options] [level]
+int solve(int argc, char **argv)
+{
+  long memLimit = MEMLIMIT, patternMemory;
+  char *tmpDir = getenv("TMPDIR");
+  int levelNumber = 1;
+  int macros = 1;
+  int i, x, result, tunnels = 0;
+  level *l;
+  board *b;
+
+  if (tmpDir == 0) tmpDir = TMPDIR;
+  for (i = 1; i < argc; i++) {
+    if (0 == strcmp(argv[i],"--mem-limit") && i+1 < argc) {
+      memLimit = parseSize(argv[++i]);
+      if (memLimit < 0) {
+	fprintf(stderr,"Bad memory limit: %s\n",argv[i]);
+	return 1;
+      }
+    } else if (0 == strcmp(argv[i],"--tmp-dir") && i+1 < argc) {
+      tmpDir = argv[++i];
+    } else if (0 == strcmp(argv[i],"--no-macros")) {
+      macros = 0;
+    } else if (isdigit(argv[i][0])) {
+      levelNumber = atoi(argv[i]);
+    } else {
+      fprintf(stderr,
+	      "usage: sokoban --solve [--mem-limit size] [--tmp-dir dir] "
+	      "[--no-macros] [level]\n");
+      return 1;
+    }
+  }
+
+  l = readLevel(levelNumber);
+  b = analyze(l);
+  if (macros) findMacros(b);
+  b->patterns = b->corrals = 1;
+  StateSize = b->stateSize;
+  fprintf(stderr,"Level %d: %d cells, %d boxes, %d symmetries\n",
+	  levelNumber,b->cells,b->boxes,b->symmetries);
+  if (b->macros) {
+    for (x = 0; x < b->cells; x++) {
+      if (tunnelCell(b,x,NORTH) || tunnelCell(b,x,EAST)) tunnels++;
+    }
+    fprintf(stderr,"Macros: %d tunnel cells, goal room with %d storage\n",
+	    tunnels,b->roomGoals);
+  }
+
+  // the buffer of children must hold every child of a state
+  patternMemory = memLimit/PATTERNSHARE;
+  if ((memLimit-patternMemory-(FANIN+3)*IOBUF)/StateSize < MAXKIDS) {
+    fprintf(stderr,"Memory limit of %ld bytes is too small\n",memLimit);
+    return 1;
+  }
+  sprintf(WorkDir,"%.200s/sokoban.XXXXXX",tmpDir);
+  if (0 == mkdtemp(WorkDir)) {
+    fprintf(stderr,"Could not create a directory in %s\n",tmpDir);
+    return 1;
+  }
+  signal(SIGINT,interrupted);
+  signal(SIGTERM,interrupted);
+  signal(SIGHUP,interrupted);
+  loadPatterns(b,patternMemory);
+  result = search(b,memLimit-patternMemory);
+  removeWorkDir();
+  savePatterns(b);
+  return result ? 0 : 2;
+}
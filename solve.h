@@ -0,0 +1,94 @@
+// Definitions shared by the sokoban solver.
+#ifndef SOLVE_H
+#define SOLVE_H
+#include "sokoban.h"
+
+// Size of the position space (see rc2p: 6 bits of row, 6 bits of column)
+#define MAXPOS (1<<12)
+
+// Largest number of boxes the solver will consider
+#define MAXBOX 64
+
+// Most children a single state may have (a push per box per direction)
+#define MAXKIDS (4*MAXBOX)
+
+// Deadlock databases (see deadlock.c):
+#define PATTERNLOC "saves/deadlock.%d"
+#define SHAPELOC "saves/deadlock.shared"
+
+/*
+ * A state is an array of unsigned shorts: the worker's cell, followed by the
+ * cells of the boxes in increasing order.  Cells are numbered 0..cells-1 and
+ * cover only the floor the worker could ever reach.  States are compared
+ * with memcmp, so any two equal positions have identical bytes.  The search
+ * keeps states in canonical form (see canon.c).
+ */
+
+/*
+ * The static portion of a level, as seen by the solver.
+ * Everything here is computed once, after the level is read.
+ */
+typedef struct board_st {
+  int levelNumber;          // as in the level structure
+  int rows, cols;           // dimensions of level
+  int cells;                // number of floor cells
+  int boxes;                // number of boxes in play
+  int goals;                // number of storage locations
+  int stateSize;            // bytes in a state: (1+boxes) shorts
+  int pos[MAXPOS];          // cell -> position (see rc2p)
+  int cell[MAXPOS];         // position -> cell, or -1 if not floor
+  int next[MAXPOS][5];      // neighbouring cell in direction 1..4, or -1
+  char goal[MAXPOS];        // 1 iff cell is a storage location
+  char dead[MAXPOS];        // 1 iff a box here can never be stored
+  unsigned short start[MAXBOX+1]; // the initial state
+  int symmetries;           // transformations of the floor onto itself
+  int map[8][MAXPOS];       // cell -> image of cell, per symmetry
+  // structure used by macro moves (see macro.c)
+  int macros;               // 1 iff macro moves are in use
+  char articulation[MAXPOS];// 1 iff cell separates the floor
+  char tunnel[MAXPOS];      // walls on both sides: bit NORTH or EAST by axis
+  char room[MAXPOS];        // 1 iff cell is in the goal room
+  int entrance, entryDir;   // cell leading into the room, and direction in
+  int roomGoals;            // storage locations in the room (0: no room)
+  int order[MAXBOX];        // storage locations, in packing order
+  char *roomPath[MAXBOX];   // pushes, by direction, from entrance to order[k]
+  // deadlock detection (see deadlock.c)
+  int patterns;             // 1 iff frozen boxes are looked for
+  int corrals;              // 1 iff pushes are limited by PI-corrals
+  unsigned corral[MAXPOS];  // label of the corral holding cell
+  unsigned corralMark;      // last label used
+  unsigned corralChosen;    // label of the corral whose pushes we make
+  // scratch space, used while expanding states
+  int boxAt[MAXPOS];        // 1+index of box at cell, or 0
+  unsigned reach[MAXPOS];   // cell was reached in flood number reachMark
+  unsigned reachMark;       // (both cleared when the count wraps)
+  int queue[MAXPOS];
+} board;
+
+/*
+ * An edge of the search graph: the box at cell box is pushed pushes
+ * times in direction dir or, if path is set, in the directions path[i].
+ */
+typedef struct edge_st {
+  int box;
+  int dir;
+  int pushes;
+  char *path;
+} edge;
+
+// (see documentation in solve.c)
+extern board *analyze(level *l);
+extern void canonical(board *b, unsigned short *s);
+extern int deadlocked(board *b, int x);
+extern int expand(board *b, unsigned short *s, unsigned short *kids, edge *how);
+extern int findCorral(board *b, unsigned short *s);
+extern void findMacros(board *b);
+extern int findSymmetries(board *b);
+extern int flood(board *b, int from);
+extern void loadPatterns(board *b, long memory);
+extern int opposite(int dir);
+extern void placeBoxes(board *b, unsigned short *s, int on);
+extern void savePatterns(board *b);
+extern int solved(board *b, unsigned short *s);
+extern int tunnelCell(board *b, int x, int dir);
+#endif